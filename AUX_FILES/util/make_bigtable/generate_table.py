@@ -1,5 +1,10 @@
 import csv
 import os
+import sys
+
+# Shared report reader (report_reader.py at the top of the replay tree)
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", ".."))
+from report_reader import get_report
 
 def hms_dir(run_number):
     return f"/work/hallc/c-rsidis/replay/pass0p1/REPORT_OUTPUT/HMS/PRODUCTION/replay_hms_coin_production_{run_number}_-1.report"
@@ -10,7 +15,8 @@ def shms_dir(run_number):
 def coin_dir(run_number):
     return f"/work/hallc/c-rsidis/replay/pass0p1/REPORT_OUTPUT/COIN/PRODUCTION/replay_coin_production_{run_number}_-1.report"
 
-# Mapping: variable -> (line_index, char_start, char_end)
+# Mapping: variable -> (line_index, char_start, char_end), or (key, delimiter,
+# skip) looked up by name as in ExtractValueFromReportFile
 HMS_MAP = {
     "BCM1_Q": (36,22,32),
     "BCM1_I": (29,22,29),
@@ -104,17 +110,13 @@ def parse_report_file(report_path, mapping):
         # If file doesn't exist, return empty dict
         return props
 
-    with open(report_path, "r") as f:
-        lines = f.readlines()
-        for var, (line_idx, start, end) in mapping.items():
-            try:
-                segment = lines[line_idx][start:end].strip()
-                # Try to convert to float if possible
-                props[var] = float(segment)
-#                if (var == "ps1" or var == "ps2" or var =="ps3" or var == "ps4" or var == "ps5" or var =="ps6"):
-#                    props[var] = segment
-            except (IndexError, ValueError):
-                props[var] = None
+    # Entries are (line_index, char_start, char_end) or (key, delimiter, skip)
+    report = get_report(report_path)
+    for var, entry in mapping.items():
+        if isinstance(entry[0], str):
+            props[var] = report.value(*entry)
+        else:
+            props[var] = report.field(*entry)
     return props
 
 
@@ -0,0 +1,325 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Sorted-range index of run-range parameter files (standard.kinematics,
+standard.database, ...).
+
+A run-range file is read by THcParmList::Load(file, run) as a list of
+blocks: a line of run numbers/ranges ("1711-1722", "24428-24535,24564-24571")
+starts a block, and the lines up to the next range line are loaded only if
+the run is in one of its ranges. Lines before the first range line apply to
+every run. Overlapping blocks are all applied, in file order.
+
+The index splits the run axis at every range boundary into disjoint
+elementary intervals, each holding the (file-ordered) list of blocks that
+cover it. Resolving a run is one binary search; a sorted batch of runs is
+resolved in one merge walk. The index is written next to the source as
+<file>.rridx and rebuilt automatically when the source size or mtime changes.
+
+Index layout (little endian), version INDEX_VERSION:
+  "HCRRIDX" magic, version, source size, source mtime (s)
+  blocks:    flags (1 = applies to all runs), first body line, byte offset,
+             byte length of the body
+  intervals: first run, last run, offset and count in the block lists
+  lists:     block numbers
+The same file is read by SCRIPTS/run_range_index.C in the replays.
+
+Usage:
+  run_range_index.py build DBASE/COIN/standard.kinematics
+  run_range_index.py lookup DBASE/COIN/standard.kinematics 23977
+  run_range_index.py table DBASE/COIN/standard.kinematics -l runlist.txt \\
+      -p gpbeam,hpcentral,htheta_lab,ppcentral,ptheta_lab
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import bisect
+import csv
+import os
+import struct
+import sys
+
+MAGIC = b'HCRRIDX\0'
+INDEX_VERSION = 1
+INDEX_SUFFIX = '.rridx'
+ALL_RUNS = 1
+MAX_RUN = 0x7fffffff
+
+HEADER = struct.Struct('<8sIQq')
+BLOCK = struct.Struct('<IIQQ')
+INTERVAL = struct.Struct('<iiII')
+COUNT = struct.Struct('<I')
+
+
+def strip_line(line):
+    '''Line without comment and surrounding whitespace, as hcana sees it.'''
+    return line.split('#', 1)[0].strip()
+
+
+def parse_ranges(line):
+    '''Run ranges of a range line, None if the line is not one.'''
+    if not line or line.strip(' \t0123456789-,'):
+        return None
+    ranges = []
+    for field in line.split(','):
+        field = field.replace(' ', '').replace('\t', '')
+        if not field:
+            continue
+        first, dash, last = field.partition('-')
+        try:
+            lo = int(first)
+            hi = int(last) if last else (MAX_RUN if dash else lo)
+        except ValueError:
+            return None
+        ranges.append((lo, hi))
+    return ranges or None
+
+
+def scan_blocks(path):
+    '''One pass over the source: [flags, first body line, offset, length,
+    ranges] for every block.'''
+    blocks = [[ALL_RUNS, 1, 0, 0, []]]
+    offset = 0
+    with open(path, 'rb') as fp:
+        for lineno, raw in enumerate(fp, 1):
+            ranges = parse_ranges(strip_line(raw.decode('latin-1')))
+            if ranges is not None:
+                blocks[-1][3] = offset - blocks[-1][2]
+                blocks.append([0, lineno + 1, offset + len(raw), 0, ranges])
+            offset += len(raw)
+    blocks[-1][3] = offset - blocks[-1][2]
+    return blocks
+
+
+def build_intervals(blocks):
+    '''Elementary intervals of the run axis with the blocks covering them.'''
+    edges = {}
+    for number, block in enumerate(blocks):
+        for lo, hi in block[4]:
+            if lo > hi:
+                # Never matches in hcana either
+                print('[WARNING] Empty run range %d-%d on line %d'
+                      % (lo, hi, block[1] - 1), file=sys.stderr)
+                continue
+            edges.setdefault(lo, []).append((number, 1))
+            if hi < MAX_RUN:
+                edges.setdefault(hi + 1, []).append((number, -1))
+    points = sorted(edges)
+    active = {}
+    intervals = []
+    for i, point in enumerate(points):
+        for number, step in edges[point]:
+            active[number] = active.get(number, 0) + step
+            if active[number] == 0:
+                del active[number]
+        if not active:
+            continue
+        last = points[i + 1] - 1 if i + 1 < len(points) else MAX_RUN
+        intervals.append((point, last, sorted(active)))
+    return intervals
+
+
+def source_stamp(path):
+    return os.path.getsize(path), int(os.path.getmtime(path))
+
+
+def build_index(path, idxfile=None):
+    '''Write the index of path, returns the index file name.'''
+    idxfile = idxfile or path + INDEX_SUFFIX
+    blocks = scan_blocks(path)
+    intervals = build_intervals(blocks)
+    size, mtime = source_stamp(path)
+    out = [HEADER.pack(MAGIC, INDEX_VERSION, size, mtime),
+           COUNT.pack(len(blocks))]
+    for flags, line, offset, length, ranges in blocks:
+        out.append(BLOCK.pack(flags, line, offset, length))
+    out.append(COUNT.pack(len(intervals)))
+    nlist = 0
+    for lo, hi, members in intervals:
+        out.append(INTERVAL.pack(lo, hi, nlist, len(members)))
+        nlist += len(members)
+    out.append(COUNT.pack(nlist))
+    for lo, hi, members in intervals:
+        out.append(struct.pack('<%dI' % len(members), *members))
+    tmp = '%s.tmp%d' % (idxfile, os.getpid())
+    with open(tmp, 'wb') as fp:
+        fp.write(b''.join(out))
+    os.rename(tmp, idxfile)
+    return idxfile
+
+
+class RunRangeIndex:
+    '''Read-only view of the index of one run-range file.'''
+
+    def __init__(self, path, idxfile=None, rebuild=True):
+        self.path = path
+        self.idxfile = idxfile or path + INDEX_SUFFIX
+        if not self.read() and rebuild:
+            print('[INFO] Indexing %s' % path, file=sys.stderr)
+            build_index(path, self.idxfile)
+            if not self.read():
+                sys.exit('[ERROR] Cannot read index %s' % self.idxfile)
+        with open(path, 'rb') as fp:
+            self.text = fp.read()
+
+    def read(self):
+        '''Load the index, False if it is missing, foreign or stale.'''
+        if not os.path.exists(self.idxfile):
+            return False
+        with open(self.idxfile, 'rb') as fp:
+            data = fp.read()
+        if len(data) < HEADER.size:
+            return False
+        magic, version, size, mtime = HEADER.unpack_from(data, 0)
+        if magic != MAGIC or version != INDEX_VERSION:
+            return False
+        if (size, mtime) != source_stamp(self.path):
+            print('[INFO] %s is out of date' % self.idxfile, file=sys.stderr)
+            return False
+        pos = HEADER.size
+        nblock = COUNT.unpack_from(data, pos)[0]
+        pos += COUNT.size
+        self.blocks = [BLOCK.unpack_from(data, pos + i * BLOCK.size)
+                       for i in range(nblock)]
+        pos += nblock * BLOCK.size
+        ninterval = COUNT.unpack_from(data, pos)[0]
+        pos += COUNT.size
+        self.intervals = [INTERVAL.unpack_from(data, pos + i * INTERVAL.size)
+                          for i in range(ninterval)]
+        pos += ninterval * INTERVAL.size
+        nlist = COUNT.unpack_from(data, pos)[0]
+        pos += COUNT.size
+        self.lists = struct.unpack_from('<%dI' % nlist, data, pos)
+        self.starts = [iv[0] for iv in self.intervals]
+        self.global_blocks = [i for i, b in enumerate(self.blocks)
+                              if b[0] & ALL_RUNS]
+        return True
+
+    def _interval_blocks(self, k, run):
+        lo, hi, first, count = self.intervals[k]
+        if run > hi:
+            return []
+        return list(self.lists[first:first + count])
+
+    def blocks_for(self, run):
+        '''Numbers of the blocks loaded for run, in file order.'''
+        k = bisect.bisect_right(self.starts, run) - 1
+        members = self._interval_blocks(k, run) if k >= 0 else []
+        return sorted(self.global_blocks + members)
+
+    def blocks_for_many(self, runs):
+        '''{run: blocks} for many runs, one walk over the sorted runs.'''
+        result = {}
+        k = 0
+        for run in sorted(set(runs)):
+            while k < len(self.starts) and self.starts[k] <= run:
+                k += 1
+            members = self._interval_blocks(k - 1, run) if k > 0 else []
+            result[run] = sorted(self.global_blocks + members)
+        return result
+
+    def block_text(self, number):
+        flags, line, offset, length = self.blocks[number]
+        return self.text[offset:offset + length].decode('latin-1')
+
+    def resolve_text(self, run):
+        '''Lines hcana loads for run, range lines dropped.'''
+        return ''.join(self.block_text(b) for b in self.blocks_for(run))
+
+    def params(self, run, blocks=None):
+        '''{name: value string} for run, later blocks override earlier ones.
+        Array continuation lines are appended to the previous value.'''
+        values = {}
+        name = None
+        if blocks is None:
+            blocks = self.blocks_for(run)
+        for number in blocks:
+            for line in self.block_text(number).splitlines():
+                line = strip_line(line)
+                if not line:
+                    continue
+                if '=' in line:
+                    name, value = line.split('=', 1)
+                    name = name.strip()
+                    values[name] = value.strip().strip('"')
+                elif name is not None:
+                    values[name] += ',' + line
+        return values
+
+
+def read_runlist(path):
+    '''Single-column run list, lines starting with ! or # are skipped.'''
+    runs = []
+    with open(path) as fp:
+        for line in fp:
+            line = line.strip()
+            if not line or line[0] in '!#':
+                continue
+            try:
+                runs.append(int(line.split()[0].split(',')[0]))
+            except ValueError:
+                continue
+    return runs
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    sub = parser.add_subparsers(dest='command')
+    build = sub.add_parser('build', help='(Re)build the index of a file')
+    build.add_argument('file')
+    lookup = sub.add_parser('lookup', help='Lines loaded for runs')
+    lookup.add_argument('file')
+    lookup.add_argument('runs', type=int, nargs='+')
+    lookup.add_argument('-b', '--blocks', action='store_true',
+                        help='Print block numbers and source lines only')
+    table = sub.add_parser('table', help='CSV of parameters for many runs')
+    table.add_argument('file')
+    table.add_argument('runs', type=int, nargs='*')
+    table.add_argument('-l', '--runlist', type=str, help='Run list file')
+    table.add_argument('-p', '--params', type=str, required=True,
+                       help='Comma-separated parameter names')
+    args = parser.parse_args()
+    if args.command is None:
+        parser.error('a command is required')
+    return args
+
+
+def main():
+    args = get_args()
+    if not os.path.exists(args.file):
+        sys.exit('[ERROR] %s not found' % args.file)
+
+    if args.command == 'build':
+        idxfile = build_index(args.file)
+        index = RunRangeIndex(args.file, rebuild=False)
+        print('[INFO] %s: %d blocks, %d intervals' % (
+            idxfile, len(index.blocks), len(index.intervals)))
+        return
+
+    index = RunRangeIndex(args.file)
+    if args.command == 'lookup':
+        for run in args.runs:
+            if args.blocks:
+                print('%d: %s' % (run, ' '.join(
+                    '%d(line %d)' % (b, index.blocks[b][1])
+                    for b in index.blocks_for(run))))
+            else:
+                print('# run %d' % run)
+                sys.stdout.write(index.resolve_text(run))
+        return
+
+    runs = list(args.runs)
+    if args.runlist:
+        runs += read_runlist(args.runlist)
+    names = [p for p in args.params.split(',') if p]
+    resolved = index.blocks_for_many(runs)
+    out = csv.writer(sys.stdout, lineterminator='\n')
+    out.writerow(['run'] + names)
+    for run in runs:
+        values = index.params(run, resolved[run])
+        out.writerow([run] + [values.get(n, '') for n in names])
+
+
+if __name__ == '__main__':
+    main()
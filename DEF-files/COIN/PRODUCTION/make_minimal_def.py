@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Generate a minimal DEF-file holding only the tree variables that
+downstream consumers read.
+
+The consumers (by default the get_good_*_ev.C macros and both
+make_skimmed_rootfile.C) and the local files they #include (sidis_kinematics.C,
+analysis_cuts.C, ...) are scanned for tree variable names (H.*, P.*, T.*,
+CTime.*, ...; the prefixes are taken from the source DEF-file), also inside
+cut strings and RDataFrame expressions. Names built in the code from a
+spectrometer string, as arm + ".gtr.px", are taken with the values the
+string is given there (std::string elarm = "H"), or with every spectrometer
+given to such a string in any consumer if it has none. Every name must be written by the source DEF-file
+(block patterns or variable lines, #include'd var files included); names it
+does not write are reported, and built names with a given spectrometer that
+it does not write are an error (no output is written). The output keeps the
+histogram #include lines of the source (unless --no-histos) and the EPICS
+variables that a consumer references.
+
+Cuts (DEF-files/*/CUTS) and report templates are evaluated on the live
+analyzer variables during the replay, so they do not need tree branches;
+pass them with -c only for the variables they should also keep in the tree.
+
+The expected per-event output size is printed from a replayed ROOT file of
+the source DEF if one is given (-r, needs PyROOT), else estimated as 8 bytes
+(Double_t) per selected variable.
+
+Usage:
+  make_minimal_def.py DEF-files/COIN/PRODUCTION/coin_production_pElec_hProt_light.def \\
+      -o DEF-files/COIN/PRODUCTION/coin_production_pElec_hProt_minimal.def \\
+      [-c extra_macro.C] [-r ROOTfiles/coin_replay_production_24000_-1.root]
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import datetime
+import fnmatch
+import os
+import re
+import sys
+
+defaultConsumers = [
+    'get_good_coin_ev.C',
+    'get_good_dis_ev.C',
+    'get_good_heep_ev.C',
+    'make_skimmed_rootfile.C',
+    'AUX_FILES/util/make_skimfiles/make_skimmed_rootfile.C',
+]
+
+nameRegex = re.compile(r'\b([A-Za-z]\w*)((?:\.[A-Za-z_]\w*)+)')
+includeRegex = re.compile(r'^#include\s+"([^"]+)"')
+# arm + ".gtr.px"
+builtRegex = re.compile(r'\b([A-Za-z_]\w*)\s*\+\s*"((?:\.[A-Za-z_]\w*)+)"')
+# std::string elarm = "H"  or  std::string specvar = ... ? "H" : "P"
+armRegex = re.compile(r'\bstd::string\s+([A-Za-z_]\w*)\s*=\s*"([A-Za-z]\w*)"')
+armChoiceRegex = re.compile(
+    r'\bstd::string\s+([A-Za-z_]\w*)\s*=[^;\n]*\?\s*"([A-Za-z]\w*)"\s*:\s*"([A-Za-z]\w*)"')
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    parser.add_argument('source', help='DEF-file the production pass uses now')
+    parser.add_argument(
+        '-o', '--output', type=str, help='Minimal DEF-file, default stdout')
+    parser.add_argument(
+        '-c', '--consumer', action='append', default=[],
+        help='Extra file reading the tree (macro, cuts, template)')
+    parser.add_argument(
+        '--only', action='store_true',
+        help='Scan only the -c files, not the default consumers')
+    parser.add_argument(
+        '--no-histos', action='store_true',
+        help='Drop the histogram #include lines too')
+    parser.add_argument(
+        '-r', '--rootfile', type=str,
+        help='ROOT file replayed with the source DEF, for the size estimate')
+    return parser.parse_args()
+
+
+class DefFile:
+    '''Tree content of a DEF-file: block patterns, variables, EPICS
+    variables, and the #include lines that only hold histograms.'''
+
+    def __init__(self, fileName):
+        self.blocks = []
+        self.variables = []
+        self.epics = []
+        self.histoIncludes = []
+        self.read(fileName, top=True)
+
+    def read(self, fileName, top=False):
+        hasVars = False
+        inEpics = False
+        with open(fileName, 'r') as fi:
+            for line in fi:
+                line = line.strip()
+                m = includeRegex.match(line)
+                if m:
+                    if self.read(m.group(1)) or not top:
+                        continue
+                    self.histoIncludes.append(line)
+                    continue
+                if not line or line.startswith('#'):
+                    continue
+                words = line.split()
+                if inEpics:
+                    if words[0] == 'end' and words[1:2] == ['epics']:
+                        inEpics = False
+                    else:
+                        self.epics.append(words[0])
+                    continue
+                if words[0] == 'begin' and words[1:2] == ['epics']:
+                    inEpics = True
+                elif words[0] == 'block' and len(words) > 1:
+                    self.blocks.append(words[1])
+                    hasVars = True
+                elif words[0] == 'variable' and len(words) > 1:
+                    self.variables.append(words[1])
+                    hasVars = True
+        return hasVars
+
+    def prefixes(self):
+        '''Leading name component of every pattern (CTime* -> CTime).'''
+        prefixes = set()
+        for p in self.blocks + self.variables:
+            m = re.match(r'[A-Za-z]\w*', p)
+            if m:
+                prefixes.add(m.group(0))
+        return prefixes
+
+    def writes(self, name):
+        return name in self.variables or \
+            any(fnmatch.fnmatchcase(name, b) for b in self.blocks)
+
+
+def with_local_includes(fileNames):
+    '''The files and, recursively, the files they #include "..." that exist
+    relative to the including file.'''
+    seen = set()
+    result = []
+    todo = list(fileNames)
+    while todo:
+        fileName = todo.pop(0)
+        key = os.path.realpath(fileName)
+        if key in seen:
+            continue
+        seen.add(key)
+        result.append(fileName)
+        with open(fileName, 'r') as fi:
+            for line in fi:
+                m = includeRegex.match(line.strip())
+                if not m:
+                    continue
+                inc = os.path.normpath(
+                    os.path.join(os.path.dirname(fileName), m.group(1)))
+                if os.path.exists(inc):
+                    todo.append(inc)
+    return result
+
+
+def scan_consumer(fileName, prefixes, epics):
+    '''Tree variable names and EPICS names referenced in one file, the
+    names built from a spectrometer string with a given value (which must be
+    written), the name ends built from one without, and the spectrometers
+    given to strings.'''
+    names = set()
+    epicsUsed = set()
+    required = set()
+    optional = set()
+    with open(fileName, 'r') as fi:
+        text = fi.read()
+    arms = {}
+    for m in armRegex.finditer(text):
+        arms.setdefault(m.group(1), set()).add(m.group(2))
+    for m in armChoiceRegex.finditer(text):
+        arms.setdefault(m.group(1), set()).update(m.group(2, 3))
+    for m in builtRegex.finditer(text):
+        var, rest = m.group(1), m.group(2)
+        if var in arms:
+            built = set(a + rest for a in arms[var] if a in prefixes)
+            names |= built
+            required |= built
+        else:
+            optional.add(rest)
+    for m in nameRegex.finditer(text):
+        prefix, rest = m.group(1), m.group(2)
+        if prefix == 'Ndata':
+            # Ndata.X is written with X
+            prefix, dot, rest = rest[1:].partition('.')
+            rest = dot + rest
+        if prefix in prefixes:
+            names.add(prefix + rest)
+    for name in epics:
+        if re.search(r'(?<![\w.])' + re.escape(name) + r'(?![\w.])', text):
+            epicsUsed.add(name)
+    allArms = set(a for v in arms.values() for a in v if a in prefixes)
+    return names, epicsUsed, required, optional, allArms
+
+
+def branch_sizes(rootFile):
+    '''{branch: (bytes, zipped bytes)} per event of tree T, None without
+    PyROOT.'''
+    try:
+        import ROOT
+    except ImportError:
+        print('[WARNING] PyROOT not available, using the static estimate',
+              file=sys.stderr)
+        return None
+    f = ROOT.TFile.Open(rootFile)
+    if not f or f.IsZombie():
+        print('[WARNING] Cannot open {}'.format(rootFile), file=sys.stderr)
+        return None
+    tree = f.Get('T')
+    n = max(tree.GetEntries(), 1)
+    sizes = {}
+    for branch in tree.GetListOfBranches():
+        sizes[branch.GetName()] = (branch.GetTotBytes() / n,
+                                   branch.GetZipBytes() / n)
+    f.Close()
+    return sizes
+
+
+def main():
+    args = get_args()
+    source = DefFile(args.source)
+    prefixes = source.prefixes()
+
+    consumers = list(args.consumer)
+    if not args.only:
+        consumers = defaultConsumers + consumers
+    for fileName in consumers:
+        if not os.path.exists(fileName):
+            print('[WARNING] Consumer {} not found'.format(fileName),
+                  file=sys.stderr)
+    consumers = with_local_includes(c for c in consumers if os.path.exists(c))
+    names = set()
+    epicsUsed = set()
+    required = set()
+    builtRests = set()
+    arms = set()
+    for fileName in consumers:
+        n, e, r, o, a = scan_consumer(fileName, prefixes, source.epics)
+        names |= n
+        epicsUsed |= e
+        required |= r
+        builtRests |= o
+        arms |= a
+    # Names built from a string of unknown spectrometer: with every
+    # spectrometer of the consumers, kept where the source writes them
+    names |= set(n for n in (a + r for a in arms for r in builtRests)
+                 if source.writes(n))
+
+    # Keep only names the source writes; a reference like H.kin.primary
+    # (prefix of a written name) selects nothing on its own.
+    selected = sorted(n for n in names if source.writes(n))
+    missing = sorted(n for n in names if not source.writes(n) and
+                     not any(v.startswith(n + '.') for v in names))
+    for name in missing:
+        print('[WARNING] {} is read downstream but not written by {}'
+              .format(name, args.source), file=sys.stderr)
+    # Columns the kernels (sidis_kinematics.C, ...) read by built names:
+    # without them the consumers fail at their Define
+    unmet = sorted(required - set(selected))
+    if unmet:
+        print('[ERROR] {} built from a spectrometer name in the consumers '
+              'but not in the minimal DEF, not writing it'
+              .format(', '.join(unmet)), file=sys.stderr)
+        sys.exit(1)
+
+    lines = [
+        '# Minimal DEF-file generated by make_minimal_def.py from',
+        '#   {}'.format(args.source),
+        '# on {} for the consumers'.format(datetime.date.today()),
+    ]
+    lines += ['#   {}'.format(c) for c in consumers if os.path.exists(c)]
+    lines.append('# Regenerate it rather than editing by hand.')
+    group = None
+    for name in selected:
+        prefix = name.rsplit('.', 1)[0]
+        if prefix != group:
+            lines.append('')
+            group = prefix
+        lines.append('variable {}'.format(name))
+    if epicsUsed:
+        lines += ['', 'begin epics']
+        lines += [e for e in source.epics if e in epicsUsed]
+        lines.append('end epics')
+    if source.histoIncludes and not args.no_histos:
+        lines.append('')
+        lines += source.histoIncludes
+    text = '\n'.join(lines) + '\n'
+
+    if args.output:
+        with open(args.output, 'w') as fo:
+            fo.write(text)
+    else:
+        sys.stdout.write(text)
+
+    # Expected output size per event
+    sizes = branch_sizes(args.rootfile) if args.rootfile else None
+    print('[INFO] {} of {} referenced variables selected, {} EPICS variables'
+          .format(len(selected), len(names), len(epicsUsed)), file=sys.stderr)
+    if sizes:
+        keep = [b for b in sizes if b in selected or
+                (b.startswith('Ndata.') and b[6:] in selected)]
+        tot = sum(sizes[b][0] for b in keep)
+        zipped = sum(sizes[b][1] for b in keep)
+        allTot = sum(s[0] for s in sizes.values())
+        allZipped = sum(s[1] for s in sizes.values())
+        print('[INFO] Tree T per event: {:.0f} B ({:.0f} B compressed), '
+              'source DEF {:.0f} B ({:.0f} B compressed)'.format(
+                  tot, zipped, allTot, allZipped), file=sys.stderr)
+    else:
+        print('[INFO] Tree T per event: about {} B uncompressed '
+              '(8 B per variable, arrays counted once)'.format(
+                  8 * len(selected)), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,336 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Compile a crate map and a detector map into a validated binary map.
+
+Reads MAPS/db_cratemap.dat (crate -> slot -> module model, bank) and a
+detector map as read by THcDetectorMap::Load (e.g. MAPS/COIN/DETEC/coin.map,
+or the output of merge_maps.py), checks them against each other and writes
+<detector map>c (coin_phaseII.map -> coin_phaseII.mapc) holding dense
+crate/slot/channel -> detector/plane/counter/signal tables. The binary map
+is read by SCRIPTS/compiled_map.C with O(1) channel lookup.
+
+Errors (no output written):
+  - channel mapped twice within a detector (plane >= 1000 reference
+    channels excepted),
+  - channel shared by two detectors, unless --allow-shared or listed in
+    knownShared,
+  - detector/plane/counter/signal reached from two channels,
+  - slot not in the crate map, channel beyond the module's channel count,
+  - channel line before ROC= and SLOT=, detector ID without a header line.
+
+Binary layout (little endian), version MAP_VERSION:
+  "HCMAPC" magic, version, sources (path, size, mtime)
+  detectors: ID, name, signals
+  slots:     roc, slot, model, bank, nchan, first channel
+  channels:  first entry (nchan + 1 per slot, entries of a channel are
+             first[ch] .. first[ch+1]-1)
+  entries:   detector, plane, counter, signal, refindex, refchan
+
+Usage:
+  compile_maps.py MAPS/COIN/DETEC/coin_phaseII.map [-c MAPS/db_cratemap.dat]
+  compile_maps.py MAPS/COIN/DETEC/coin_phaseII.map --check
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b'HCMAPC\0\0'
+MAP_VERSION = 1
+REF_PLANE = 1000
+
+# Channels per module model; unknown models are sized by the map
+moduleChannels = {
+    250: 16,
+    775: 32,
+    792: 32,
+    1190: 128,
+    1290: 128,
+    3800: 32,
+    3801: 32,
+}
+
+# Channels read by two detectors on purpose, per map file name:
+# {map: {(roc, slot, channel): detector IDs}}; reported as warnings.
+# coin.map, coin_phaseII.map: the SHMS noble gas Cherenkov (21) and the 2Y
+# hodoscope (23) tables both list FADC ROC 2 slot 9 channels 2, 4, 5 and 6,
+# as the production replay has always loaded them.
+pngcerP2Y = {(2, 9, chan): {21, 23} for chan in (2, 4, 5, 6)}
+knownShared = {
+    'coin.map': pngcerP2Y,
+    'coin_phaseII.map': pngcerP2Y,
+}
+
+slotKWs = ['REFCHAN', 'REFINDEX']
+skipKWs = ['MASK', 'NSUBADD', 'BSUB']
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    parser.add_argument('detmap', help='Detector map file')
+    parser.add_argument(
+        '-c', '--cratemap', type=str, help='Crate map file',
+        default='MAPS/db_cratemap.dat')
+    parser.add_argument(
+        '-o', '--output', type=str, help='Binary map, default <detmap>c')
+    parser.add_argument(
+        '--allow-shared', action='store_true',
+        help='Channels read by two detectors are warnings, not errors')
+    parser.add_argument(
+        '--check', action='store_true', help='Validate only, write nothing')
+    return parser.parse_args()
+
+
+def read_cratemap(fileName):
+    '''{(roc, slot): (model, bank)} of a crate map.'''
+    slots = {}
+    roc = None
+    with open(fileName, 'r') as fi:
+        for lineno, line in enumerate(fi, 1):
+            line = line.split('#', 1)[0].strip()
+            if not line:
+                continue
+            if line.startswith('===='):
+                roc = int(line.split()[2])
+                continue
+            values = line.split()
+            if roc is None or not values[0].isdigit():
+                continue
+            slot = int(values[0])
+            model = int(values[1]) if len(values) > 1 else 0
+            bank = int(values[2]) if len(values) > 2 else 0
+            if (roc, slot) in slots:
+                raise MapError('{}:{}: crate {} slot {} defined twice'.format(
+                    fileName, lineno, roc, slot))
+            slots[(roc, slot)] = (model, bank)
+    return slots
+
+
+class MapError(Exception):
+    pass
+
+
+class Slot:
+    '''One crate slot, with the entries of each channel.'''
+
+    def __init__(self, roc, slot):
+        self.roc = roc
+        self.ID = slot
+        self.channels = {}
+
+
+def read_detmap(fileName, allowShared=False):
+    '''Detectors {ID: (name, signals)} and slots {(roc, slot): Slot} of a
+    detector map. Collects all errors and warnings.'''
+    detectors = {}
+    slots = {}
+    targets = {}
+    shared = knownShared.get(os.path.basename(fileName), {})
+    errors = []
+    warnings = []
+    detector = roc = slot = None
+    # REFINDEX/REFCHAN apply to the channel lines that follow them, up to
+    # the next SLOT=, as in THcDetectorMap::Load
+    KWs = {}
+
+    with open(fileName, 'r') as fi:
+        for lineno, line in enumerate(fi, 1):
+            where = '{}:{}'.format(fileName, lineno)
+            line = line.strip()
+            if not line:
+                continue
+
+            # Header line, eg: ! HCAL_ID=4   ::  ADC
+            if line.startswith('!'):
+                i = line.find('_ID=')
+                if i > -1:
+                    name = line[1:i].strip()
+                    ID = int(line[i + 4:].split()[0])
+                    signals = line[i + 4:].split('::', 1)[-1].strip() \
+                        if '::' in line else ''
+                    if ID in detectors:
+                        errors.append('{}: detector ID {} already used by {}'
+                                      .format(where, ID, detectors[ID][0]))
+                    detectors[ID] = (name, signals)
+                continue
+
+            line = ''.join(line.split('!', 1)[0].split())
+            if not line:
+                continue
+
+            i = line.find('=')
+            if i > -1:
+                command = line[:i].upper()
+                value = int(line[i + 1:])
+                if command == 'DETECTOR':
+                    detector = value
+                    if detector not in detectors:
+                        errors.append('{}: detector ID {} has no header line'
+                                      .format(where, detector))
+                    roc = slot = None
+                elif command == 'ROC':
+                    roc = value
+                    slot = None
+                elif command == 'SLOT':
+                    if roc is None:
+                        errors.append('{}: SLOT before ROC'.format(where))
+                        continue
+                    slot = slots.setdefault((roc, value), Slot(roc, value))
+                    KWs = {}
+                elif command in slotKWs:
+                    if slot is None:
+                        errors.append('{}: {} before SLOT'.format(where, command))
+                        continue
+                    KWs[command] = value
+                elif command not in skipKWs:
+                    errors.append('{}: unknown command `{}`'.format(where, command))
+                continue
+
+            # This must be channel line.
+            if slot is None or detector is None:
+                errors.append('{}: channel line outside DETECTOR/ROC/SLOT'
+                              .format(where))
+                continue
+            try:
+                values = [int(v) for v in line.split(',')]
+            except ValueError:
+                errors.append('{}: bad channel line `{}`'.format(where, line))
+                continue
+            if len(values) < 3:
+                errors.append('{}: bad channel line `{}`'.format(where, line))
+                continue
+            chan, plane, counter = values[:3]
+            signal = values[3] if len(values) > 3 else 0
+            entry = (detector, plane, counter, signal)
+            entries = slot.channels.setdefault(chan, [])
+
+            if plane < REF_PLANE:
+                for other, otherWhere in entries:
+                    if other[1] >= REF_PLANE:
+                        continue
+                    message = '{}: crate {} slot {} channel {} already mapped ' \
+                              'to detector {} plane {} counter {} signal {} ' \
+                              '({})'.format(where, roc, slot.ID, chan,
+                                            *(other[:4] + (otherWhere,)))
+                    if other[0] != detector and (allowShared or {
+                            other[0], detector} <= shared.get(
+                                (roc, slot.ID, chan), set())):
+                        warnings.append(message)
+                    else:
+                        errors.append(message)
+                if entry in targets:
+                    errors.append('{}: detector {} plane {} counter {} '
+                                  'signal {} already read from crate {} '
+                                  'slot {} channel {}'.format(
+                                      where, detector, plane, counter, signal,
+                                      *targets[entry]))
+                targets[entry] = (roc, slot.ID, chan)
+            entries.append((entry + (KWs.get('REFINDEX', -1),
+                                     KWs.get('REFCHAN', -1)), where))
+
+    return detectors, slots, errors, warnings
+
+
+def check_crates(slots, crates, errors):
+    '''Slots against the crate map, channels against the module size.'''
+    for (roc, slotID), slot in sorted(slots.items()):
+        if (roc, slotID) not in crates:
+            errors.append('crate {} slot {} is not in the crate map'
+                          .format(roc, slotID))
+            continue
+        model = crates[(roc, slotID)][0]
+        nchan = moduleChannels.get(model)
+        if nchan is None:
+            continue
+        for chan, entries in sorted(slot.channels.items()):
+            where = entries[0][1]
+            if not 0 <= chan < nchan:
+                errors.append('{}: channel {} out of range for model {} '
+                              '({} channels)'.format(where, chan, model, nchan))
+
+
+def source_stamp(path):
+    return os.path.getsize(path), int(os.path.getmtime(path))
+
+
+def pack_string(s):
+    data = s.encode('utf-8')
+    return struct.pack('<I', len(data)) + data
+
+
+def write_binary(outName, sources, detectors, slots, crates):
+    out = [MAGIC, struct.pack('<II', MAP_VERSION, len(sources))]
+    for path in sources:
+        size, mtime = source_stamp(path)
+        out.append(pack_string(path) + struct.pack('<Qq', size, mtime))
+
+    out.append(struct.pack('<I', len(detectors)))
+    for ID, (name, signals) in sorted(detectors.items()):
+        out.append(struct.pack('<I', ID) + pack_string(name) +
+                   pack_string(signals))
+
+    out.append(struct.pack('<I', len(slots)))
+    firsts = []
+    entries = []
+    for (roc, slotID), slot in sorted(slots.items()):
+        model, bank = crates.get((roc, slotID), (0, 0))
+        nchan = moduleChannels.get(model, 0)
+        if slot.channels:
+            nchan = max(nchan, max(slot.channels) + 1)
+        out.append(struct.pack('<IIIIII', roc, slotID, model, bank, nchan,
+                               len(firsts)))
+        for chan in range(nchan):
+            firsts.append(len(entries))
+            for entry, where in slot.channels.get(chan, []):
+                entries.append(entry)
+        firsts.append(len(entries))
+
+    out.append(struct.pack('<I', len(firsts)))
+    out.append(struct.pack('<%dI' % len(firsts), *firsts))
+    out.append(struct.pack('<I', len(entries)))
+    for entry in entries:
+        out.append(struct.pack('<HHHHhh', *entry))
+
+    tmp = '{}.tmp{}'.format(outName, os.getpid())
+    with open(tmp, 'wb') as fo:
+        fo.write(b''.join(out))
+    os.rename(tmp, outName)
+    return len(entries)
+
+
+def main():
+    args = get_args()
+    outName = args.output or args.detmap + 'c'
+
+    try:
+        crates = read_cratemap(args.cratemap)
+    except (IOError, MapError, ValueError, IndexError) as err:
+        sys.exit('[ERROR] {}'.format(err))
+    detectors, slots, errors, warnings = read_detmap(args.detmap,
+                                                     args.allow_shared)
+    check_crates(slots, crates, errors)
+
+    for warning in warnings:
+        print('[WARNING] {}'.format(warning))
+    if errors:
+        for error in errors:
+            print('[ERROR] {}'.format(error))
+        sys.exit('[ERROR] {} problems in {}, no binary map written'
+                 .format(len(errors), args.detmap))
+
+    nchan = sum(len(s.channels) for s in slots.values())
+    print('[INFO] {}: {} detectors, {} slots, {} channels'.format(
+        args.detmap, len(detectors), len(slots), nchan))
+    if args.check:
+        return
+    nentries = write_binary(outName, [args.cratemap, args.detmap], detectors,
+                            slots, crates)
+    print('[INFO] Wrote {} ({} table entries)'.format(outName, nentries))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,332 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Split one CODA (EVIO v4) raw-file segment into N event-range shards.
+
+Used by run_coin_segments.sh to spread a single large segment over several
+replay workers. The segment is scanned once into an event-offset index
+(<outdir>/<segment>.idx, rebuilt only when the segment changes). Each shard
+is then written as a standalone EVIO file holding
+
+  - the dictionary and "first event" of the segment, if present,
+  - the prestart/go control events and the latest event of every
+    re-delivered type (config 125, EPICS 180-182 by default) seen before
+    the shard window, so the workers start with the same run configuration
+    and EPICS state as a serial replay,
+  - all events of the shard window, unchanged and in order.
+
+Windows hold an equal number of physics events and start on a physics event.
+Delayed scaler types (129/131, SetDelayedType in the replay scripts) are
+buffered by THcScalerEvtHandler until the end of the run, so they are never
+re-delivered: that would add them twice. They stay in the window they were
+taken in; run-level scaler sums come from the serial scaler pass
+(replay_scalers_coin_segments.C) in any case.
+
+Usage:
+  coda_shard.py -r 1234 -s 0 -n 8 [-o raw_shards]
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+MAGIC = 0xc0da0100
+BLOCK_HEADER_WORDS = 8
+DICTIONARY_BIT = 0x100
+LAST_BLOCK_BIT = 0x200
+FIRST_EVENT_BIT = 0x4000
+
+CODA3_PHYSICS = (0xff50, 0xff8f)
+CODA3_PRESTART_GO = (0xffd1, 0xffd2)
+CODA2_PRESTART_GO = (17, 18)
+
+INDEX_STRIDE = 1000
+MAX_BLOCK_WORDS = 1 << 18
+MAX_BLOCK_EVENTS = 10000
+
+rawDirs = ['.', './raw', './raw/../raw.copiedtotape', './cache']
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        '-r', '--run', type=int, help='Run number', required=True)
+    parser.add_argument(
+        '-s', '--segment', type=int, help='Raw-file segment', default=0)
+    parser.add_argument(
+        '-n', '--shards', type=int, help='Number of shards', required=True)
+    parser.add_argument(
+        '-o', '--outdir', type=str, help='Shard and index directory',
+        default='raw_shards')
+    parser.add_argument(
+        '--redeliver', type=str, default='125,180,181,182',
+        help='Event types re-delivered to every shard (latest before window)')
+    parser.add_argument(
+        '--delayed', type=str, default='129,131',
+        help='Delayed scaler event types, never re-delivered')
+    return parser.parse_args()
+
+
+def is_physics(tag):
+    return CODA3_PHYSICS[0] <= tag <= CODA3_PHYSICS[1] or 1 <= tag <= 15
+
+
+class Segment:
+    '''Sequential EVIO v4 reader yielding (block offset, event offset,
+    event length in bytes, tag) for every event.'''
+
+    def __init__(self, path):
+        self.path = path
+        self.fp = open(path, 'rb')
+        head = self.fp.read(BLOCK_HEADER_WORDS * 4)
+        if len(head) < BLOCK_HEADER_WORDS * 4:
+            sys.exit('[ERROR] %s is too short for an EVIO file' % path)
+        for endian in ('>', '<'):
+            if struct.unpack(endian + 'I', head[28:32])[0] == MAGIC:
+                self.endian = endian
+                break
+        else:
+            sys.exit('[ERROR] %s: no EVIO block magic word' % path)
+        version = struct.unpack(self.endian + 'I', head[20:24])[0] & 0xff
+        if version != 4:
+            sys.exit('[ERROR] %s: EVIO version %d, only version 4 is supported'
+                     % (path, version))
+        self.fp.seek(0)
+
+    def word(self, data, i):
+        return struct.unpack(self.endian + 'I', data[4 * i:4 * i + 4])[0]
+
+    def blocks(self, start=0):
+        self.fp.seek(start)
+        while True:
+            offset = self.fp.tell()
+            head = self.fp.read(BLOCK_HEADER_WORDS * 4)
+            if len(head) < BLOCK_HEADER_WORDS * 4:
+                return
+            nwords = self.word(head, 0)
+            hlen = self.word(head, 2)
+            info = self.word(head, 5)
+            body = self.fp.read(nwords * 4 - BLOCK_HEADER_WORDS * 4)
+            yield offset, hlen, info, head + body
+            if info & LAST_BLOCK_BIT:
+                return
+
+    def events(self, start=0):
+        for boff, hlen, info, data in self.blocks(start):
+            pos = hlen * 4
+            while pos + 8 <= len(data):
+                length = (self.word(data, pos // 4) + 1) * 4
+                tag = self.word(data, pos // 4 + 1) >> 16
+                yield boff, boff + pos, length, tag, info, data[pos:pos + length]
+                pos += length
+
+    def event_number(self, event, tag):
+        '''Raw (TI) event number of a physics event, -1 if not found.'''
+        if len(event) < 28:
+            return -1
+        if tag >= 0xff00:
+            # Built trigger bank, first segment starts with the 64-bit
+            # number of the first event in the bank
+            return struct.unpack(self.endian + 'Q', event[20:28])[0]
+        # CODA 2: event ID bank, first data word
+        return self.word(event, 4)
+
+
+def build_index(seg, idxfile):
+    '''One pass over the segment: stride checkpoints of the physics events
+    and the position of every non-physics event.'''
+    index = {
+        'file': os.path.realpath(seg.path),
+        'size': os.path.getsize(seg.path),
+        'mtime': os.path.getmtime(seg.path),
+        'stride': INDEX_STRIDE,
+        'header': [],
+        'phys': [],
+        'other': [],
+        'nphys': 0,
+        'end': 0,
+        'info': 0,
+    }
+    first = True
+    nheader = 0
+    for boff, eoff, length, tag, info, event in seg.events():
+        if first:
+            index['info'] = info & (DICTIONARY_BIT | FIRST_EVENT_BIT)
+            nheader = (1 if info & DICTIONARY_BIT else 0) + \
+                      (1 if info & FIRST_EVENT_BIT else 0)
+            first = False
+        if len(index['header']) < nheader:
+            index['header'].append([eoff, length, tag])
+        elif is_physics(tag):
+            if index['nphys'] % INDEX_STRIDE == 0:
+                index['phys'].append([index['nphys'], boff, eoff,
+                                      seg.event_number(event, tag)])
+            index['nphys'] += 1
+        else:
+            index['other'].append([eoff, length, tag])
+        index['end'] = eoff + length
+    with open(idxfile + '.tmp', 'w') as fp:
+        json.dump(index, fp)
+    os.rename(idxfile + '.tmp', idxfile)
+    return index
+
+
+def load_index(seg, idxfile):
+    if os.path.exists(idxfile):
+        with open(idxfile) as fp:
+            index = json.load(fp)
+        if index['size'] == os.path.getsize(seg.path) and \
+           index['mtime'] == os.path.getmtime(seg.path):
+            return index
+        print('[INFO] %s is out of date, rebuilding' % idxfile)
+    return build_index(seg, idxfile)
+
+
+class BlockWriter:
+    '''Writes events into EVIO v4 blocks in the byte order of the source.'''
+
+    def __init__(self, path, endian, header_info):
+        self.fp = open(path, 'wb')
+        self.endian = endian
+        self.header_info = header_info
+        self.number = 1
+        self.events = []
+        self.nwords = 0
+
+    def add(self, event):
+        if self.events and (self.nwords + len(event) // 4 > MAX_BLOCK_WORDS or
+                            len(self.events) >= MAX_BLOCK_EVENTS):
+            self.flush()
+        self.events.append(event)
+        self.nwords += len(event) // 4
+
+    def flush(self, last=False):
+        info = 4 | (LAST_BLOCK_BIT if last else 0)
+        if self.number == 1:
+            info |= self.header_info
+        head = struct.pack(self.endian + '8I',
+                           BLOCK_HEADER_WORDS + self.nwords, self.number,
+                           BLOCK_HEADER_WORDS, len(self.events), 0, info, 0,
+                           MAGIC)
+        self.fp.write(head)
+        for event in self.events:
+            self.fp.write(event)
+        self.number += 1
+        self.events = []
+        self.nwords = 0
+
+    def close(self):
+        self.flush(last=True)
+        self.fp.close()
+
+
+def read_event(seg, offset, length):
+    seg.fp.seek(offset)
+    return seg.fp.read(length)
+
+
+def write_shard(seg, index, path, begin, end, lead_in):
+    '''Shard file: header events and lead-in first, then every event with
+    begin <= offset < end.'''
+    out = BlockWriter(path, seg.endian, index['info'])
+    for eoff, length, tag in index['header']:
+        out.add(read_event(seg, eoff, length))
+    for eoff, length, tag in lead_in:
+        out.add(read_event(seg, eoff, length))
+
+    # Start reading at the block holding the first event of the window
+    start_block = 0
+    for ordinal, boff, eoff, evnum in index['phys']:
+        if eoff > begin:
+            break
+        start_block = boff
+    nevents = 0
+    for boff, eoff, length, tag, info, event in seg.events(start_block):
+        if eoff < begin or any(eoff == h[0] for h in index['header']):
+            continue
+        if eoff >= end:
+            break
+        out.add(event)
+        nevents += 1
+    out.close()
+    return nevents
+
+
+def main():
+    args = get_args()
+    redeliver = set(int(t) for t in args.redeliver.split(',') if t)
+    delayed = set(int(t) for t in args.delayed.split(',') if t)
+    if redeliver & delayed:
+        sys.exit('[ERROR] Delayed scaler types %s cannot be re-delivered'
+                 % sorted(redeliver & delayed))
+    if args.shards < 1:
+        sys.exit('[ERROR] Need at least one shard')
+
+    name = 'rsidis_production_%05d.dat.%d' % (args.run, args.segment)
+    path = None
+    for d in rawDirs:
+        if os.path.exists(os.path.join(d, name)):
+            path = os.path.join(d, name)
+            break
+    if path is None:
+        sys.exit('[ERROR] Raw file %s not found' % name)
+    if not os.path.isdir(args.outdir):
+        os.makedirs(args.outdir)
+
+    seg = Segment(path)
+    index = load_index(seg, os.path.join(args.outdir, name + '.idx'))
+    nphys = index['nphys']
+    stride = index['stride']
+    phys = index['phys']
+    if nphys == 0:
+        sys.exit('[ERROR] No physics events in %s' % path)
+
+    # Window boundaries on index checkpoints, equal physics counts
+    bounds = []
+    for k in range(min(args.shards, len(phys))):
+        point = phys[min(int(round(k * nphys / args.shards / stride)),
+                         len(phys) - 1)]
+        if not bounds or point[0] > bounds[-1][0]:
+            bounds.append(point)
+    nshards = len(bounds)
+    first_offset = index['header'][-1][0] + index['header'][-1][1] \
+        if index['header'] else 0
+
+    manifest = []
+    for k in range(nshards):
+        begin = first_offset if k == 0 else bounds[k][2]
+        end = bounds[k + 1][2] if k + 1 < nshards else index['end']
+        lead_in = []
+        if k > 0:
+            latest = {}
+            for eoff, length, tag in index['other']:
+                if eoff >= begin:
+                    break
+                if tag in CODA3_PRESTART_GO or tag in CODA2_PRESTART_GO:
+                    lead_in.append([eoff, length, tag])
+                elif tag in redeliver:
+                    latest[tag] = [eoff, length, tag]
+            lead_in += latest.values()
+            lead_in.sort()
+        shard = os.path.join(args.outdir, '%s.shard%d' % (name, k))
+        nevents = write_shard(seg, index, shard, begin, end, lead_in)
+        first_phys = bounds[k][0]
+        last_phys = (bounds[k + 1][0] if k + 1 < nshards else nphys) - 1
+        manifest.append('%s %d %d %d %d %d' % (
+            shard, first_phys, last_phys, bounds[k][3], nevents,
+            len(lead_in)))
+        print('[INFO] %s: physics events %d-%d (%d events, %d re-delivered)'
+              % (shard, first_phys, last_phys, nevents, len(lead_in)))
+
+    with open(os.path.join(args.outdir, name + '.shards'), 'w') as fp:
+        fp.write('# shard first_phys last_phys first_evnum nevents nredelivered\n')
+        fp.write('\n'.join(manifest) + '\n')
+    print(nshards)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Parse-once reader of hcana replay reports (REPORT_OUTPUT/*/*.report).
+
+Python side of report_reader.C, with the same index and the same cache
+<report>.index.json next to the report, so a report parsed by the
+get_good_*_ev.C macros is not parsed again by the bigtable generator and
+vice versa.
+
+Every ':' or '=' of a report line gives an entry [delimiter, label, value]:
+the label is the whitespace-normalised text before the delimiter, the value
+the first number after the first delimiter of that kind in the line (None if
+there is none). A key matches an entry if it is the end of the label at a
+word boundary ("BCM2 Beam Cut Charge" matches "HMS BCM2 Beam Cut Charge"),
+and skip counts the matches to pass over, as ExtractValueFromReportFile.
+
+Fixed-column fields of the bigtable maps (line, first char, last char) are
+read from the report lines with field().
+
+Usage:
+  report_reader.py REPORT_OUTPUT/COIN/PRODUCTION/replay_coin_production_23876_-1.report \\
+                   -k "SHMS BCM2 Beam Cut Charge" -k "E SING FID TRACK EFFIC" -s 1
+  report_reader.py <report> --dump
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import json
+import os
+import re
+
+# Number at the start of a string, as std::istream >> double reads it
+numberRe = re.compile(r'[ \t\n\v\f\r]*([+-]?(?:\d+\.?\d*|\.\d+)(?:[eE][+-]?\d+)?)')
+# Whitespace as isspace() in the C locale
+spaceRe = re.compile(r'[ \t\n\v\f\r]+')
+delimiters = (':', '=')
+
+
+def normalize(text):
+    '''Trim and collapse whitespace to single spaces'''
+    return spaceRe.sub(' ', text).strip(' ')
+
+
+def leading_number(text):
+    m = numberRe.match(text)
+    return float(m.group(1)) if m else None
+
+
+def parse_line(line, entries):
+    line = normalize(line)
+    for d in delimiters:
+        first = line.find(d)
+        if first < 0:
+            continue
+        value = leading_number(line[first + 1:])
+        pos = first
+        while pos >= 0:
+            label = line[:pos].rstrip(' ')
+            if label:
+                entries.append((d, label, value))
+            pos = line.find(d, pos + 1)
+
+
+class ReplayReport(object):
+    '''Index of one report, from the cache if it is current'''
+
+    def __init__(self, path, write_cache=True):
+        self.path = path
+        self.entries = []
+        self.index = {}
+        self._lines = None
+        self.ok = os.path.exists(path)
+        if not self.ok:
+            return
+        st = os.stat(path)
+        self.size, self.mtime = st.st_size, int(st.st_mtime)
+        if not self._read_cache():
+            for line in self.lines():
+                parse_line(line, self.entries)
+            if write_cache:
+                self._write_cache()
+        for i, (d, label, value) in enumerate(self.entries):
+            self.index.setdefault(label, []).append(i)
+            pos = label.find(' ')
+            while pos >= 0:
+                self.index.setdefault(label[pos + 1:], []).append(i)
+                pos = label.find(' ', pos + 1)
+
+    @staticmethod
+    def cache_name(path):
+        return path + '.index.json'
+
+    def lines(self):
+        '''Report lines, read on first use (split at \\n only, as std::getline)'''
+        if self._lines is None:
+            with open(self.path, 'r', encoding='latin-1', newline='\n') as f:
+                self._lines = [line.rstrip('\n') for line in f]
+        return self._lines
+
+    def values(self, key, delimiter=':'):
+        '''All numbers of key with delimiter, in report order'''
+        return [self.entries[i][2] for i in self.index.get(normalize(key), [])
+                if self.entries[i][0] == delimiter and self.entries[i][2] is not None]
+
+    def value(self, key, delimiter=':', skip=0):
+        '''Number of key after skip matches, None if not found'''
+        matches = 0
+        for i in self.index.get(normalize(key), []):
+            d, label, value = self.entries[i]
+            if d != delimiter:
+                continue
+            if matches < skip:
+                matches += 1
+                continue
+            if value is not None:
+                return value
+        return None
+
+    def field(self, line_idx, start, end):
+        '''Number in columns [start, end) of line line_idx, None if there is none'''
+        try:
+            return float(self.lines()[line_idx][start:end].strip())
+        except (IndexError, ValueError):
+            return None
+
+    def _read_cache(self):
+        try:
+            with open(self.cache_name(self.path), 'r') as f:
+                cache = json.load(f)
+        except (IOError, OSError, ValueError):
+            return False
+        if cache.get('size') != self.size or cache.get('mtime') != self.mtime:
+            return False
+        self.entries = [tuple(e) for e in cache.get('entries', [])]
+        return True
+
+    def _write_cache(self):
+        cache = self.cache_name(self.path)
+        tmp = '{}.tmp{}'.format(cache, os.getpid())
+        try:
+            with open(tmp, 'w') as f:
+                f.write('{\n "source": %s, "size": %d, "mtime": %d,\n "entries": [\n'
+                        % (json.dumps(self.path), self.size, self.mtime))
+                f.write(',\n'.join('  ' + json.dumps(list(e)) for e in self.entries))
+                f.write('\n ]\n}\n')
+            os.rename(tmp, cache)
+        except (IOError, OSError):
+            if os.path.exists(tmp):
+                os.remove(tmp)
+
+
+_reports = {}
+
+
+def get_report(path):
+    '''Shared reader of path, reparsed if the report changed'''
+    report = _reports.get(path)
+    if report is not None and report.ok and os.path.exists(path):
+        st = os.stat(path)
+        if st.st_size == report.size and int(st.st_mtime) == report.mtime:
+            return report
+    report = ReplayReport(path)
+    _reports[path] = report
+    return report
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    parser.add_argument('report', type=str, help='Replay report file')
+    parser.add_argument(
+        '-k', '--key', type=str, action='append', default=[],
+        help='Key to look up (several allowed)')
+    parser.add_argument(
+        '-d', '--delimiter', type=str, default=':', choices=delimiters,
+        help='Delimiter after the key')
+    parser.add_argument(
+        '-s', '--skip', type=int, default=0, help='Matches to skip')
+    parser.add_argument(
+        '--dump', action='store_true', help='Print all entries')
+    return parser.parse_args()
+
+
+def main():
+    args = get_args()
+    report = get_report(args.report)
+    if not report.ok:
+        print('[ERROR] Unable to open file {}'.format(args.report))
+        return 1
+    if args.dump:
+        for d, label, value in report.entries:
+            print('{} {} {}'.format(d, label, value))
+    for key in args.key:
+        print('{} {} {}'.format(key, args.delimiter,
+                                report.value(key, args.delimiter, args.skip)))
+    return 0
+
+
+if __name__ == '__main__':
+    exit(main())
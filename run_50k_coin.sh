@@ -138,6 +138,8 @@ hydra_configs=(
 
   # Link the ROOT file to latest for online monitoring
   ln -fs ${rootFile} ${latestRootFile}  
+  # and the analysis results file (a sidecar of the replay file)
+  ln -fs output_get_good_coin_ev_${runNum}_${numEvents}.root ${rootFileDir}/output_get_good_coin_ev_${runNum}_latest.root
   
   echo ""
   echo ""
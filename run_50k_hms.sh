@@ -135,6 +135,8 @@ hydra_configs=(
 
   # Link the ROOT file to latest for online monitoring
   ln -fs ${rootFile} ${latestRootFile}
+  # and the analysis results file (a sidecar of the replay file)
+  ln -fs ${spec}_output_get_good_dis_ev_${runNum}_${numEvents}.root ${rootFileDir}/${spec}_output_get_good_dis_ev_${runNum}_latest.root
   
   echo ""
   echo ""
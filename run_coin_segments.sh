@@ -0,0 +1,227 @@
+#!/bin/bash
+
+# Segment-parallel COIN production replay of a full run.
+# One hcana worker per raw-file segment plus one serial scaler/EPICS pass
+# over the whole run side by side; merge_coin_segments.C then writes
+# ROOT file, summary and report under the names of a serial replay
+# (coin_replay_production_<run>_-1.root, ...).
+# With shards > 1 every segment is first split into event-range shards by
+# coda_shard.py (one indexed pass over the segment), and each shard gets its
+# own worker, so a run taken as one huge segment can still fill a node.
+#
+# The replay is resumable: every worker that finished with all its outputs
+# leaves a marker in REPORT_OUTPUT/COIN/PRODUCTION/BATCH/checkpoint_*, and a
+# rerun after a crash or a preempted slot only replays the workers without
+# one (the scaler pass likewise). The shards are the checkpoints, so a single segment run with
+# shards > 1 and max_jobs 1 is a serial replay that can be resumed after
+# any shard. The markers are removed once the run is merged.
+#
+# Usage: ./run_coin_segments.sh <run> [hElec_pProt|pElec_hProt] [max_jobs] [shards]
+
+run_number=$1
+kin=$2
+max_jobs=$3
+shards=$4
+events=-1
+
+if [ -z "$run_number" ]; then
+    echo "[ERROR] Run number is required."
+    exit 1
+fi
+
+if [ -z "$kin" ]; then
+    kin="hElec_pProt"
+fi
+
+if [ -z "$max_jobs" ]; then
+    max_jobs=$(nproc)
+fi
+
+if [ -z "$shards" ]; then
+    shards=1
+fi
+
+spec="coin"
+SPEC="COIN"
+
+# Helicity scalers are only enabled in the hElec_pProt replay
+if [ "$kin" = "hElec_pProt" ]; then
+    helScalers=1
+else
+    helScalers=0
+fi
+
+# Paths
+script="SCRIPTS/${SPEC}/PRODUCTION/replay_production_${spec}_${kin}.C"
+scalerScript="SCRIPTS/${SPEC}/PRODUCTION/replay_scalers_coin_segments.C"
+mergeScript="SCRIPTS/${SPEC}/PRODUCTION/merge_coin_segments.C"
+shardScript="SCRIPTS/${SPEC}/PRODUCTION/coda_shard.py"
+shardDir="./raw_shards"
+reportFileDir="./REPORT_OUTPUT/${SPEC}/PRODUCTION"
+batchOutDir="${reportFileDir}/BATCH"
+checkpointDir="${batchOutDir}/checkpoint_${spec}_production_${run_number}_${events}"
+rawDirs=". ./raw ./raw/../raw.copiedtotape ./cache"
+
+# Count the raw-file segments of the run
+nseg=0
+while :; do
+    segFile=$(printf "rsidis_production_%05d.dat.%d" "$run_number" "$nseg")
+    found=0
+    for dir in $rawDirs; do
+	if [ -e "${dir}/${segFile}" ]; then
+	    found=1
+	    break
+	fi
+    done
+    [ $found -eq 1 ] || break
+    nseg=$((nseg + 1))
+done
+
+if [ $nseg -eq 0 ]; then
+    echo "[ERROR] No raw-file segments found for run $run_number."
+    exit 1
+fi
+
+replayLog="${batchOutDir}/replay_${spec}_production_${run_number}_${events}_segments.log"
+mkdir -p "$batchOutDir" "$checkpointDir"
+
+# Run a worker and mark it done if it succeeded and wrote all of the given
+# outputs; the marker lists them. Usage:
+#   run_worker <name> <log> <hcana command> <outputs...>
+run_worker() {
+    local name=$1 log=$2 cmd=$3
+    shift 3
+    hcana -l -b -q "$cmd" &> "$log" || return 1
+    for out in "$@"; do
+	if [ ! -s "$out" ]; then
+	    echo "[ERROR] ${name}: missing output ${out}" >> "$log"
+	    return 1
+	fi
+    done
+    printf "%s\n" "$@" > "${checkpointDir}/${name}.done"
+}
+
+# True if a worker is marked done and its outputs are still there
+worker_done() {
+    local marker="${checkpointDir}/$1.done"
+    [ -e "$marker" ] || return 1
+    while read -r out; do
+	[ -s "$out" ] || return 1
+    done < "$marker"
+}
+
+echo "[INFO] Replay Log: $replayLog"
+{
+  echo "=================================================================="
+  echo "Segment-parallel COIN replay of run $run_number ($nseg segments, $kin)"
+  echo "Start time: $(date)"
+  echo "=================================================================="
+
+  pids=()
+  names=()
+
+  # Serial scaler/EPICS pass first, it has to read every segment
+  if worker_done scalers; then
+      echo "[INFO] Scaler pass already done, skipping"
+  else
+      log="${batchOutDir}/replay_${spec}_scalers_${run_number}_${events}.log"
+      run_worker scalers "$log" "${scalerScript}(${run_number}, ${events}, ${nseg}, ${helScalers})" \
+	  "ROOTfiles/coin_scalers_production_${run_number}_${events}.root" \
+	  "${reportFileDir}/scalercounts_production_${run_number}_${events}.txt" &
+      pids+=($!)
+      names+=("scaler pass")
+  fi
+
+  for ((seg = 0; seg < nseg; seg++)); do
+      if [ "$shards" -gt 1 ] && [ -e "${checkpointDir}/seg${seg}.nshard" ]; then
+	  # Shards written before the restart; only re-split if one that is
+	  # still to be replayed is gone
+	  nshard=$(cat "${checkpointDir}/seg${seg}.nshard")
+	  for ((shard = 0; shard < nshard; shard++)); do
+	      worker_done "seg${seg}_shard${shard}" || \
+		  [ -e "${shardDir}/$(printf "rsidis_production_%05d.dat.%d.shard%d" "$run_number" "$seg" "$shard")" ] || \
+		  nshard=""
+	  done
+      else
+	  nshard=""
+      fi
+      if [ "$shards" -gt 1 ] && [ -z "$nshard" ]; then
+	  nshard=$(python3 "$shardScript" -r "$run_number" -s "$seg" -n "$shards" -o "$shardDir" | tail -1)
+	  if ! [ "$nshard" -gt 0 ] 2>/dev/null; then
+	      echo "[ERROR] Could not shard segment ${seg}."
+	      failed_shard=1
+	      break
+	  fi
+	  echo "$nshard" > "${checkpointDir}/seg${seg}.nshard"
+      fi
+      for ((shard = 0; shard < ${nshard:-1}; shard++)); do
+	  while [ "$(jobs -rp | wc -l)" -ge "$max_jobs" ]; do
+	      sleep 5
+	  done
+	  if [ "$shards" -gt 1 ]; then
+	      tag="seg${seg}_shard${shard}"
+	      args="${run_number}, ${events}, ${seg}, ${shard}"
+	  else
+	      tag="seg${seg}"
+	      args="${run_number}, ${events}, ${seg}"
+	  fi
+	  if worker_done "$tag"; then
+	      echo "[INFO] ${tag} already done, skipping"
+	      continue
+	  fi
+	  log="${batchOutDir}/replay_${spec}_production_${run_number}_${events}_${tag}.log"
+	  run_worker "$tag" "$log" "${script}(${args})" \
+	      "ROOTfiles/coin_replay_production_${run_number}_${events}_${tag}.root" \
+	      "${reportFileDir}/summary_production_${run_number}_${events}_${tag}.report" \
+	      "${reportFileDir}/segcounts_production_${run_number}_${events}_${tag}.txt" &
+	  pids+=($!)
+	  names+=("${tag}")
+	  echo "[INFO] Started ${tag}, log ${log}"
+      done
+  done
+
+  failed=${failed_shard:-0}
+  for i in "${!pids[@]}"; do
+      wait "${pids[$i]}"
+      status=$?
+      if [ $status -ne 0 ]; then
+	  echo "[ERROR] ${names[$i]} failed with status $status."
+	  failed=1
+      else
+	  echo "[SUCCESS] ${names[$i]} completed."
+      fi
+  done
+
+  if [ $failed -ne 0 ]; then
+      echo "[ERROR] Not merging run $run_number, segment outputs are kept."
+      echo "[ERROR] Rerun the same command to replay only the failed workers."
+      exit 1
+  fi
+
+  echo ""
+  echo "------------------------------------------------------------------"
+  echo "Merging $nseg segments"
+  echo "------------------------------------------------------------------"
+  mergedFile="ROOTfiles/coin_replay_production_${run_number}_${events}.root"
+  rm -f "$mergedFile"
+  # Shards and markers are only removed once the merged file is there, so a
+  # rerun after a failed merge skips the workers and merges again
+  if ! hcana -l -b -q "${mergeScript}(${run_number}, ${events}, ${nseg}, 0, ${shards})" || \
+	  [ ! -s "$mergedFile" ]; then
+      echo "[ERROR] Merging run $run_number failed, segment outputs are kept."
+      echo "[ERROR] Rerun the same command to merge again."
+      exit 1
+  fi
+  rm -rf "$checkpointDir"
+  if [ "$shards" -gt 1 ]; then
+      rm -f "${shardDir}"/$(printf "rsidis_production_%05d" "$run_number").dat.*.shard*
+  fi
+
+  echo ""
+  echo "------------------------------------------------------------------"
+  echo "Replay complete for run $run_number"
+  echo "End time: $(date)"
+  echo "=================================================================="
+} 2>&1 | tee "${replayLog}"
+# exit in the logged block only leaves its subshell, pass its status on
+exit ${PIPESTATUS[0]}
@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# Streaming COIN production replay for online monitoring.
+# Follows the raw file of a run that is still being taken (segment 0) and
+# AutoSaves the ROOT file, the report and a status file every
+# <events_per_save> events or <seconds_per_save> seconds, see
+# SCRIPTS/stream_replay.C. The replay ends when the raw file has not grown
+# for a minute. Readers (panguin, get_good_coin_ev.C) can open the ROOT file
+# while it is written; the status file holds the number of complete entries
+# of T on disk.
+# After every save get_good_coin_ev.C is run in incremental mode, so the
+# yields in its output files are updated from the new entries only.
+#
+# Usage: ./run_coin_stream.sh <run> [hElec_pProt|pElec_hProt] [events_per_save] [seconds_per_save]
+
+run_number=$1
+kin=$2
+save_events=$3
+save_seconds=$4
+events=-1
+
+if [ -z "$run_number" ]; then
+    echo "[ERROR] Run number is required."
+    exit 1
+fi
+
+if [ -z "$kin" ]; then
+    kin="hElec_pProt"
+fi
+
+if [ -z "$save_events" ]; then
+    save_events=5000
+fi
+
+if [ -z "$save_seconds" ]; then
+    save_seconds=10
+fi
+
+spec="coin"
+SPEC="COIN"
+
+# Paths
+script="SCRIPTS/${SPEC}/PRODUCTION/replay_production_${spec}_${kin}.C"
+rootFileDir="./ROOTfiles"
+reportFileDir="./REPORT_OUTPUT/${SPEC}/PRODUCTION"
+rootFile="${spec}_replay_production_${run_number}_${events}.root"
+latestRootFile="${rootFileDir}/${spec}_replay_production_latest.root"
+statusFile="${reportFileDir}/stream_${spec}_production_${run_number}_${events}.status"
+replayLog="${reportFileDir}/replay_${spec}_production_${run_number}_${events}_stream.log"
+monPdfDir="./HISTOGRAMS/${SPEC}/PDF"
+analysisLog="${reportFileDir}/output_get_good_coin_ev_${run_number}_${events}_stream.log"
+runAnalysis="hcana -l -b -q \"get_good_coin_ev.C(${run_number},${events},100000,\\\"${rootFileDir}\\\",\\\"${reportFileDir}\\\",\\\"${monPdfDir}\\\",\\\"output_get_good_coin_ev\\\",false,true)\""
+mkdir -p "$reportFileDir"
+rm -f "$statusFile"
+
+# Link the ROOT file to latest right away, it is readable after the first save
+ln -fs "${rootFile}" "${latestRootFile}"
+
+echo "[INFO] Streaming replay of run $run_number ($kin)"
+echo "[INFO] Saving every $save_events events or $save_seconds s"
+echo "[INFO] Status file: $statusFile"
+echo "[INFO] Replay Log: $replayLog"
+echo "[INFO] Analysis Log: $analysisLog"
+
+hcana -l -b -q "${script}(${run_number}, ${events}, -1, -1, ${save_events}, ${save_seconds})" &> "$replayLog" &
+pid=$!
+
+# Print progress whenever the status file changes
+last=""
+while kill -0 $pid 2>/dev/null; do
+    sleep "$save_seconds"
+    [ -f "$statusFile" ] || continue
+    now=$(tr '\n' ' ' < "$statusFile")
+    if [ "$now" != "$last" ]; then
+	echo "[INFO] $(date +%T) ${now}"
+	last=$now
+	eval ${runAnalysis} >> "$analysisLog" 2>&1
+    fi
+done
+
+wait $pid
+status=$?
+if [ $status -ne 0 ]; then
+    echo "[ERROR] Streaming replay failed with status $status, see $replayLog"
+    exit 1
+fi
+eval ${runAnalysis} >> "$analysisLog" 2>&1
+ln -fs output_get_good_coin_ev_${run_number}_${events}.root ${rootFileDir}/output_get_good_coin_ev_${run_number}_latest.root
+echo "[SUCCESS] Streaming replay of run $run_number done: $(tr '\n' ' ' < "$statusFile")"
@@ -41,7 +41,7 @@ fi
 # Which scripts to run.
 script="SCRIPTS/${SPEC}/PRODUCTION/replay_production_${spec}_pElec_hProt.C"
 analysis="get_good_heep_ev.C"
-config="CONFIG/${SPEC}/PRODUCTION/${spec}_production_rsidis.cfg"
+config="CONFIG/${SPEC}/PRODUCTION/${spec}_production_rsidis_heep.cfg"
 confighms="CONFIG/${SPEC}/PRODUCTION/${spec}_production_rsidis_hms.cfg"
 configshms="CONFIG/${SPEC}/PRODUCTION/${spec}_production_rsidis_shms.cfg"
 #expertConfig="CONFIG/${SPEC}/PRODUCTION/${spec}_production_rsidis.cfg" 
@@ -82,7 +82,7 @@ monRootFile="${spec}_coin_production_${runNum}.root"
 monPdfFile="${spec}_coin_production_${runNum}.pdf"
 monExpertPdfFile="${spec}_coin_production_expert_${runNum}.pdf"
 latestMonRootFile="${monRootDir}/${spec}_coin_production_latest.root"
-latestMonPdfFile="${monPdfDir}/output_get_good_coin_ev_${runNum}_${numEvents}.pdf"
+latestMonPdfFile="${monPdfDir}/output_get_good_heep_ev_${runNum}_${numEvents}.pdf"
 latestMonPdfFilehms="${monPdfDir}/${spec}_production_hms_latest.pdf"
 latestMonPdfFileshms="${monPdfDir}/${spec}_production_shms_latest.pdf"
 
@@ -132,6 +132,8 @@ replayReport="${reportFileDir}/replayReport_${spec}_production_${runNum}_${numEv
 
   # Link the ROOT file to latest for online monitoring
   ln -fs ${rootFile} ${latestRootFile}  
+  # and the analysis results file (a sidecar of the replay file)
+  ln -fs output_get_good_heep_ev_${runNum}_${numEvents}.root ${rootFileDir}/output_get_good_heep_ev_${runNum}_latest.root
   
   echo "" 
   echo ""
@@ -0,0 +1,425 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+'''Parallel, resumable replay + analysis of a list of runs.
+
+Every run gets two stages, the hcana replay and the good-event analysis
+(get_good_coin_ev.C or get_good_heep_ev.C) which needs the replay of that
+run. The stages run as a DAG on N local slots: a finished replay makes its
+analysis ready, and ready analyses go ahead of the next replays, so the
+analysis of run k runs next to the replay of run k+1.
+
+A stage is only started if its memory estimate fits into the memory budget
+(default 90% of MemAvailable at start) next to the running stages, and if
+the node still has that much memory available. The estimate is the largest
+peak RSS seen for that stage kind so far (state file), or --mem-replay /
+--mem-analysis before the first one finished.
+
+Each stage's outcome, output files and peak RSS are written to a JSON state
+file after every change, with the command and output mtimes of the stages
+it needed. A rerun skips stages that are done with the same command, whose
+outputs still exist and whose needed stages are done and unchanged since;
+failed stages and the stages after them are retried, and a replay that is
+rerun (failed, output deleted, command changed) reruns its analysis. Logs
+go to REPORT_OUTPUT/COIN/PRODUCTION/BATCH as for run_coin_batch.sh.
+
+Usage:
+  run_scheduler.py -l AUX_FILES/FILTER_RUNLIST/pi+sidis_runs.dat [-j 16]
+  run_scheduler.py -r 23876 23878-23903 -e 50000
+  run_scheduler.py -l AUX_FILES/rsidis_runlist.dat -t HEEP -w heep -n
+'''
+
+from __future__ import division, print_function
+
+import argparse
+import json
+import os
+import signal
+import subprocess
+import sys
+import time
+
+batchOutDir = 'REPORT_OUTPUT/COIN/PRODUCTION/BATCH'
+defaultState = os.path.join(batchOutDir, 'scheduler_state.json')
+STATE_VERSION = 1
+
+# Replay script, analysis macro and analysis outputs of each workflow; the
+# analysis output prefix is output_<macro> ({base}). The results ROOT file
+# is renamed into place last by the macro.
+workflows = {
+    'coin': ('SCRIPTS/COIN/PRODUCTION/replay_production_coin_hElec_pProt.C',
+             'get_good_coin_ev.C',
+             ['{report}/{base}_{run}_{events}.csv',
+              '{pdf}/{base}_{run}_{events}.pdf',
+              '{root}/{base}_{run}_{events}.root']),
+    'heep': ('SCRIPTS/COIN/PRODUCTION/replay_production_coin_pElec_hProt.C',
+             'get_good_heep_ev.C',
+             ['{pdf}/{base}_{run}_{events}.pdf',
+              '{root}/{base}_{run}_{events}.root']),
+}
+
+# Run type column of rsidis_runlist.dat and the FILTER_RUNLIST files
+RUN_TYPE_COLUMN = 11
+
+
+def get_args():
+    '''This function parses and returns arguments passed in'''
+    parser = argparse.ArgumentParser()
+    parser.add_argument(
+        '-l', '--runlist', type=str, action='append', default=[],
+        help='Run list file (rsidis_runlist.dat format, or one run per line)')
+    parser.add_argument(
+        '-r', '--runs', type=str, nargs='+', default=[],
+        help='Runs or run ranges (23876 23878-23903)')
+    parser.add_argument(
+        '-t', '--type', type=str, action='append', default=[],
+        help='Only runs of this run type (PI+SIDIS, HEEP, ...)')
+    parser.add_argument(
+        '-w', '--workflow', type=str, default='coin',
+        choices=sorted(workflows), help='Replay and analysis to run')
+    parser.add_argument(
+        '-e', '--events', type=int, default=50000, help='Events per run')
+    parser.add_argument(
+        '-j', '--jobs', type=int, default=os.cpu_count() or 1,
+        help='Parallel slots, default number of cores')
+    parser.add_argument(
+        '--mem', type=float, help='Memory budget in GB, default 90%% of '
+        'MemAvailable')
+    parser.add_argument(
+        '--mem-replay', type=float, default=2.5,
+        help='Replay memory estimate in GB until one was measured')
+    parser.add_argument(
+        '--mem-analysis', type=float, default=1.5,
+        help='Analysis memory estimate in GB until one was measured')
+    parser.add_argument(
+        '-s', '--state', type=str, default=defaultState, help='State file')
+    parser.add_argument(
+        '--stages', type=str, default='replay,analysis',
+        help='Stages to run, default replay,analysis')
+    parser.add_argument(
+        '-f', '--force', action='store_true',
+        help='Rerun stages that are already done')
+    parser.add_argument(
+        '-n', '--dry-run', action='store_true', help='Only print the plan')
+    return parser.parse_args()
+
+
+def parse_runs(tokens):
+    runs = []
+    for tok in tokens:
+        for part in tok.split(','):
+            if '-' in part:
+                first, last = part.split('-', 1)
+                runs += list(range(int(first), int(last) + 1))
+            elif part:
+                runs.append(int(part))
+    return runs
+
+
+def read_runlist(fileName, types):
+    '''Runs of a run list file, optionally only those of the given types.'''
+    runs = []
+    with open(fileName, 'r') as fi:
+        for line in fi:
+            words = line.split('!', 1)[0].split()
+            if not words or not words[0].isdigit():
+                continue
+            if types:
+                if len(words) <= RUN_TYPE_COLUMN or \
+                        words[RUN_TYPE_COLUMN].upper() not in types:
+                    continue
+            runs.append(int(words[0]))
+    return runs
+
+
+def mem_available_gb():
+    try:
+        with open('/proc/meminfo', 'r') as fi:
+            for line in fi:
+                if line.startswith('MemAvailable:'):
+                    return int(line.split()[1]) / 1024 / 1024
+    except IOError:
+        pass
+    return None
+
+
+class Stage:
+    '''One hcana job of one run.'''
+
+    def __init__(self, run, kind, cmd, outputs, log, deps):
+        self.run = run
+        self.kind = kind
+        self.cmd = cmd
+        self.outputs = outputs
+        self.log = log
+        self.deps = deps
+        self.key = '{}/{}'.format(run, kind)
+        self.status = 'pending'
+        self.proc = None
+        self.mem = 0
+        self.start = 0
+        self.depSignatures = {}
+
+
+def make_stages(runs, workflow, events, kinds, force=False):
+    script, analysis, analysisOutputs = workflows[workflow]
+    rootDir = 'ROOTfiles'
+    reportDir = 'REPORT_OUTPUT/COIN/PRODUCTION'
+    pdfDir = 'HISTOGRAMS/COIN/PDF'
+    base = 'output_' + os.path.splitext(analysis)[0]
+    stages = []
+    for run in runs:
+        replay = None
+        if 'replay' in kinds:
+            replay = Stage(
+                run, 'replay',
+                ['hcana', '-l', '-b', '-q',
+                 '{}({}, {})'.format(script, run, events)],
+                ['{}/coin_replay_production_{}_{}.root'.format(
+                    rootDir, run, events),
+                 '{}/replay_coin_production_{}_{}.report'.format(
+                     reportDir, run, events)],
+                '{}/replay_coin_production_{}_{}.report.log'.format(
+                    batchOutDir, run, events),
+                [])
+            stages.append(replay)
+        if 'analysis' in kinds:
+            stages.append(Stage(
+                run, 'analysis',
+                ['hcana', '-l', '-b', '-q',
+                 '{}({},{},100000,"{}","{}","{}","{}",{})'
+                 .format(analysis, run, events, rootDir, reportDir, pdfDir,
+                         base, 'true' if force else 'false')],
+                [p.format(root=rootDir, report=reportDir, pdf=pdfDir, run=run,
+                          events=events, base=base)
+                 for p in analysisOutputs],
+                '{}/{}_{}_{}.log'.format(batchOutDir,
+                                         os.path.splitext(analysis)[0], run,
+                                         events),
+                [replay] if replay else []))
+    return stages
+
+
+class State:
+    '''JSON state file, rewritten atomically after every change.'''
+
+    def __init__(self, fileName, workflow, events):
+        self.fileName = fileName
+        self.prefix = '{}/{}/'.format(workflow, events)
+        self.data = {'version': STATE_VERSION, 'stages': {}, 'peak_rss_gb': {}}
+        if os.path.exists(fileName):
+            try:
+                with open(fileName, 'r') as fi:
+                    data = json.load(fi)
+                if data.get('version') == STATE_VERSION:
+                    self.data = data
+            except ValueError:
+                print('[WARNING] Ignoring unreadable state file {}'
+                      .format(fileName))
+
+    def get(self, stage):
+        return self.data['stages'].get(self.prefix + stage.key, {})
+
+    @staticmethod
+    def signature(stage):
+        '''Command and output mtimes of a stage, recorded by the stages
+        that need it.'''
+        return {'cmd': stage.cmd,
+                'outputs': {p: int(os.path.getmtime(p))
+                            for p in stage.outputs if os.path.exists(p)}}
+
+    def is_done(self, stage):
+        '''Done with the same command, outputs present, and made from the
+        current outputs of the stages it needs.'''
+        entry = self.get(stage)
+        deps = entry.get('deps', {})
+        return entry.get('status') == 'done' and \
+            entry.get('cmd') == stage.cmd and \
+            all(os.path.exists(p) for p in stage.outputs) and \
+            all(deps.get(d.key) == self.signature(d) for d in stage.deps)
+
+    def record(self, stage, **fields):
+        entry = {'status': stage.status, 'cmd': stage.cmd, 'log': stage.log}
+        entry.update(fields)
+        self.data['stages'][self.prefix + stage.key] = entry
+        if 'peak_rss_gb' in fields and stage.status == 'done':
+            peaks = self.data['peak_rss_gb']
+            peaks[stage.kind] = max(peaks.get(stage.kind, 0),
+                                    fields['peak_rss_gb'])
+        self.save()
+
+    def peak(self, kind):
+        return self.data['peak_rss_gb'].get(kind)
+
+    def save(self):
+        tmp = '{}.tmp{}'.format(self.fileName, os.getpid())
+        with open(tmp, 'w') as fo:
+            json.dump(self.data, fo, indent=1, sort_keys=True)
+        os.rename(tmp, self.fileName)
+
+
+class Scheduler:
+
+    def __init__(self, stages, state, jobs, budget, estimates):
+        self.stages = stages
+        self.state = state
+        self.jobs = jobs
+        self.budget = budget
+        self.estimates = estimates
+        self.running = {}
+
+    def estimate(self, stage):
+        peak = self.state.peak(stage.kind)
+        return 1.2 * peak if peak else self.estimates[stage.kind]
+
+    def ready(self):
+        '''Startable stages, analyses first, then in run order.'''
+        ready = []
+        for stage in self.stages:
+            if stage.status != 'pending':
+                continue
+            if any(d.status in ('failed', 'skipped') for d in stage.deps):
+                stage.status = 'skipped'
+                print('[ERROR] Skipping {}, a stage it needs failed'
+                      .format(stage.key))
+                self.state.record(stage)
+                continue
+            if all(d.status == 'done' for d in stage.deps):
+                ready.append(stage)
+        # Collected in run order, the sort is stable
+        ready.sort(key=lambda s: s.kind != 'analysis')
+        return ready
+
+    def admits(self, stage):
+        if not self.running:
+            return True
+        mem = self.estimate(stage)
+        used = sum(s.mem for s in self.running.values())
+        if used + mem > self.budget:
+            return False
+        available = mem_available_gb()
+        return available is None or available >= mem
+
+    def launch(self, stage):
+        stage.mem = self.estimate(stage)
+        stage.start = time.time()
+        stage.status = 'running'
+        stage.depSignatures = {d.key: self.state.signature(d)
+                               for d in stage.deps}
+        log = open(stage.log, 'w')
+        stage.proc = subprocess.Popen(stage.cmd, stdout=log,
+                                      stderr=subprocess.STDOUT)
+        log.close()
+        self.running[stage.proc.pid] = stage
+        self.state.record(stage, start=stage.start)
+        print('[INFO] Started {} ({:.1f} GB estimated), log {}'
+              .format(stage.key, stage.mem, stage.log))
+
+    def reap(self):
+        '''Collect finished stages, True if one finished.'''
+        finished = False
+        for pid in list(self.running):
+            wpid, status, usage = os.wait4(pid, os.WNOHANG)
+            if wpid == 0:
+                continue
+            stage = self.running.pop(pid)
+            code = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+            missing = [p for p in stage.outputs if not os.path.exists(p)]
+            stage.status = 'done' if code == 0 and not missing else 'failed'
+            end = time.time()
+            self.state.record(
+                stage, start=stage.start, end=end, returncode=code,
+                deps=stage.depSignatures,
+                peak_rss_gb=usage.ru_maxrss / 1024 / 1024,
+                outputs={p: [os.path.getsize(p), int(os.path.getmtime(p))]
+                         for p in stage.outputs if os.path.exists(p)})
+            if stage.status == 'done':
+                print('[SUCCESS] {} done in {:.0f} s'.format(
+                    stage.key, end - stage.start))
+            else:
+                print('[ERROR] {} failed with status {}{}, see {}'.format(
+                    stage.key, code,
+                    ', missing ' + ' '.join(missing) if missing else '',
+                    stage.log))
+            finished = True
+        return finished
+
+    def run(self):
+        while True:
+            for stage in self.ready():
+                if len(self.running) >= self.jobs or not self.admits(stage):
+                    break
+                self.launch(stage)
+            if not self.running:
+                break
+            if not self.reap():
+                time.sleep(1)
+
+    def stop(self):
+        for stage in self.running.values():
+            stage.proc.send_signal(signal.SIGTERM)
+        for stage in self.running.values():
+            stage.proc.wait()
+            stage.status = 'interrupted'
+            self.state.record(stage, start=stage.start, end=time.time())
+
+
+def main():
+    args = get_args()
+    types = [t.upper() for t in args.type]
+    runs = parse_runs(args.runs)
+    for fileName in args.runlist:
+        runs += read_runlist(fileName, types)
+    runs = list(dict.fromkeys(runs))
+    if not runs:
+        sys.exit('[ERROR] No runs given.')
+
+    kinds = args.stages.split(',')
+    stages = make_stages(runs, args.workflow, args.events, kinds, args.force)
+    if not os.path.isdir(batchOutDir):
+        os.makedirs(batchOutDir)
+    state = State(args.state, args.workflow, args.events)
+    ndone = 0
+    for stage in stages:
+        if not args.force and state.is_done(stage):
+            stage.status = 'done'
+    # A stage whose needed stage reruns is rerun too (stages come after
+    # the ones they need)
+    for stage in stages:
+        if stage.status == 'done' and \
+                any(d.status != 'done' for d in stage.deps):
+            stage.status = 'pending'
+        if stage.status == 'done':
+            ndone += 1
+
+    budget = args.mem
+    if budget is None:
+        available = mem_available_gb()
+        budget = 0.9 * available if available else float('inf')
+    print('[INFO] {} runs, {} stages, {} already done, {} slots, {:.1f} GB '
+          'memory budget'.format(len(runs), len(stages), ndone, args.jobs,
+                                 budget))
+    if args.dry_run:
+        for stage in stages:
+            print('{:12s} {:10s} {}'.format(stage.key, stage.status,
+                                            ' '.join(stage.cmd)))
+        return
+
+    scheduler = Scheduler(stages, state, args.jobs, budget,
+                          {'replay': args.mem_replay,
+                           'analysis': args.mem_analysis})
+    try:
+        scheduler.run()
+    except KeyboardInterrupt:
+        print('[WARNING] Interrupted, stopping running stages')
+        scheduler.stop()
+        sys.exit(1)
+
+    failed = [s.key for s in stages if s.status in ('failed', 'skipped')]
+    print('[INFO] {} of {} stages done'.format(
+        sum(s.status == 'done' for s in stages), len(stages)))
+    if failed:
+        sys.exit('[ERROR] Not done: {}'.format(' '.join(failed)))
+
+
+if __name__ == '__main__':
+    main()
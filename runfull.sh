@@ -1,27 +1,10 @@
-./run_coin_batch.sh 23876
-./run_coin_batch.sh 23878
-./run_coin_batch.sh 23879
-./run_coin_batch.sh 23880
-./run_coin_batch.sh 23881
-./run_coin_batch.sh 23882
-./run_coin_batch.sh 23883
-./run_coin_batch.sh 23884
-./run_coin_batch.sh 23885
-./run_coin_batch.sh 23886
-./run_coin_batch.sh 23887
-./run_coin_batch.sh 23888
-./run_coin_batch.sh 23889
-./run_coin_batch.sh 23890
-./run_coin_batch.sh 23891
-./run_coin_batch.sh 23892
-./run_coin_batch.sh 23893
-./run_coin_batch.sh 23894
-./run_coin_batch.sh 23895
-./run_coin_batch.sh 23896
-./run_coin_batch.sh 23897
-./run_coin_batch.sh 23898
-./run_coin_batch.sh 23899
-./run_coin_batch.sh 23901
-./run_coin_batch.sh 23902
-./run_coin_batch.sh 23903
+#!/bin/bash
 
+# Replay and get_good_coin_ev analysis of the runs below, in parallel on all
+# cores and resumable, see run_scheduler.py. Rerunning skips finished runs.
+# Extra arguments are passed on (e.g. -j 8, -e -1, -f).
+
+python3 run_scheduler.py "$@" -r \
+    23876 23878 23879 23880 23881 23882 23883 23884 23885 \
+    23886 23887 23888 23889 23890 23891 23892 23893 23894 \
+    23895 23896 23897 23898 23899 23901 23902 23903